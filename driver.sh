@@ -18,6 +18,9 @@ fi
 
 source "$ENV_FILE"
 
+# live query endpoint port (same default as the monitor when unset in the env file)
+QUERY_PORT=${QUERY_PORT:-8053}
+
 script_name=$0
 action=$1
 
@@ -62,7 +65,7 @@ case "$action" in
         fi
 
         echo "Starting DNSPerf..."
-        DNSPERF_DB_NAME=$DB_NAME DNSPERF_DB_USER=$DB_USER DNSPERF_DB_PASS=$DB_PASSWORD DNSPERF_DB_HOST=$DB_HOST "./$EXEC_FILE" $query_interval "$domains_file"
+        DNSPERF_DB_NAME=$DB_NAME DNSPERF_DB_USER=$DB_USER DNSPERF_DB_PASS=$DB_PASSWORD DNSPERF_DB_HOST=$DB_HOST DNSPERF_QUERY_PORT=$QUERY_PORT DNSPERF_QUERY_BUDGET=$QUERY_BUDGET DNSPERF_MIN_QUERY_RATE=$MIN_QUERY_RATE "./$EXEC_FILE" $query_interval "$domains_file"
 
         exit $?
         ;;
@@ -88,6 +91,36 @@ case "$action" in
         exit $?
         ;;
 
+    "live-summary")
+        echo "Live Domain Summary (from running DNSPerf):-"
+        curl -fsS "http://127.0.0.1:$QUERY_PORT/summary?domain=$2"
+        exit $?
+        ;;
+
+    "live-percentiles")
+        echo "Live Latency Percentiles over recent samples (from running DNSPerf):-"
+        curl -fsS "http://127.0.0.1:$QUERY_PORT/percentiles?domain=$2&p=${3:-50,90,99}"
+        exit $?
+        ;;
+
+    "live-samples")
+        echo "Live Recent Latency Samples (from running DNSPerf):-"
+        curl -fsS "http://127.0.0.1:$QUERY_PORT/samples?domain=$2&limit=${3:-10}"
+        exit $?
+        ;;
+
+    "live-sampling")
+        echo "Live Per-Domain Query Rates of Budgeted Sampling (from running DNSPerf):-"
+        curl -fsS "http://127.0.0.1:$QUERY_PORT/sampling?domain=$2"
+        exit $?
+        ;;
+
+    "show-metrics")
+        echo "DNSPerf Internal Metrics (Prometheus text format):-"
+        curl -fsS "http://127.0.0.1:$QUERY_PORT/metrics"
+        exit $?
+        ;;
+
     "create-db")
         mysql -u $DB_USER -p$DB_PASSWORD -h $DB_HOST -e "CREATE DATABASE IF NOT EXISTS $DB_NAME;"
         exit $?
@@ -106,7 +139,7 @@ case "$action" in
 
     *)
         echo "A DNS query latency monitoring tool for given set of domains (Eg: Top 10 Alexa Domains)"
-        echo "Usage: $script_name [ run <Query Interval (secs)> <Domain Names File (default: domains.lst)> | show-schema | show-summary | show-details | create-db | remove-db | clean]"
+        echo "Usage: $script_name [ run <Query Interval (secs)> <Domain Names File (default: domains.lst)> | show-schema | show-summary | show-details | live-summary [Domain Name] | live-percentiles [Domain Name] [Percentiles (default: 50,90,99)] | live-samples [Domain Name] [Count (default: 10)] | live-sampling [Domain Name] | show-metrics | create-db | remove-db | clean]"
         ;;
 
 esac
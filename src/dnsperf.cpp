@@ -6,6 +6,9 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <stdexcept>
+#include <cmath>
+#include <set>
 #include <signal.h>
 #include "monitor.h"
 #include <chrono>
@@ -30,6 +33,31 @@ std::vector<std::string> parse_domains(std::string filename) {
     return domains;
 }
 
+/**
+  * Function to read a numeric setting from the environment. Unset or empty
+  * variables yield the default; unparsable values terminate with an error.
+  */
+double get_env_number(const char *name, double default_value) {
+    const char *env_value = std::getenv(name);
+    if (env_value == NULL || env_value[0] == '\0') {
+        return default_value;
+    }
+
+    std::string value_str (env_value);
+    try {
+        size_t pos;
+        double value = std::stod(value_str, &pos);
+        if (pos == value_str.size() && std::isfinite(value)) {
+            return value;
+        }
+    }
+    catch (const std::logic_error &e) {
+    }
+
+    std::cerr << "Invalid value '" << value_str << "' for environment variable '" << name << "'; a number is expected." << std::endl;
+    exit(1);
+}
+
 int main(int argc, char **argv) {
 
     if (argc < 2) {
@@ -66,7 +94,30 @@ int main(int argc, char **argv) {
         db_host = std::string (env_db_host);
     }
 
-    DNSPerfMonitor monitor(refresh_interval, db_name, db_user, db_pass, db_host, domains);
+    double query_port_value = get_env_number("DNSPERF_QUERY_PORT", 8053);
+    if (!(query_port_value >= 0 && query_port_value <= 65535) || query_port_value != floor(query_port_value)) {
+        std::cerr << "Invalid live query endpoint port '" << query_port_value << "'; expected 0 (disabled) to 65535." << std::endl;
+        return 1;
+    }
+    int query_port = (int) query_port_value;
+
+    double query_budget = get_env_number("DNSPERF_QUERY_BUDGET", 0.0);
+    double min_query_rate = get_env_number("DNSPERF_MIN_QUERY_RATE", 0.001);
+
+    if (query_budget > 0 && min_query_rate <= 0) {
+        std::cerr << "A positive minimum per-domain query rate is required with a query budget." << std::endl;
+        return 1;
+    }
+
+    // the floors alone must leave part of the budget to spend on variable domains
+    std::set<std::string> unique_domains(domains.begin(), domains.end());
+    if (query_budget > 0 && min_query_rate * unique_domains.size() >= query_budget) {
+        std::cerr << "Minimum per-domain query rate " << min_query_rate << " for " << unique_domains.size() << " domains uses up the whole query budget of " <<
+            query_budget << " queries/sec; lower MIN_QUERY_RATE below " << query_budget / unique_domains.size() << " or raise QUERY_BUDGET." << std::endl;
+        return 1;
+    }
+
+    DNSPerfMonitor monitor(refresh_interval, db_name, db_user, db_pass, db_host, domains, query_port, query_budget, min_query_rate);
     monitor_ptr = &monitor;
 
 	struct sigaction sigIntHandler;
@@ -0,0 +1,323 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <mutex>
+#include "metrics.h"
+
+/**
+  * Function to get the registry of all metrics. Metrics register themselves
+  * on construction and live for the lifetime of the process.
+  */
+static std::vector<Metric *> &
+metrics_registry() {
+    static std::vector<Metric *> registry;
+    return registry;
+}
+
+static std::mutex &
+metrics_registry_mutex() {
+    static std::mutex registry_mutex;
+    return registry_mutex;
+}
+
+
+/**
+  * Function to get the metric shard assigned to the calling thread.
+  */
+static size_t
+metric_shard() {
+    static std::atomic<size_t> next_shard(0);
+    thread_local size_t shard = next_shard++ % METRIC_SHARDS;
+    return shard;
+}
+
+
+/**
+  * Function to format a duration in microseconds as seconds. Integer
+  * arithmetic keeps every digit, however large the value grows.
+  */
+static std::string
+usecs_to_secs(unsigned long usecs) {
+    std::ostringstream os;
+    os << (usecs / 1000000);
+
+    unsigned long fraction = usecs % 1000000;
+    if (fraction != 0) {
+        std::ostringstream fraction_os;
+        fraction_os << std::setw(6) << std::setfill('0') << fraction;
+        std::string fraction_str = fraction_os.str();
+        os << "." << fraction_str.substr(0, fraction_str.find_last_not_of('0') + 1);
+    }
+
+    return os.str();
+}
+
+
+/**
+  * Function to combine a metric's own labels with an extra label.
+  */
+static std::string
+format_labels(const std::string &labels, const std::string &extra) {
+    if (labels.empty() && extra.empty()) {
+        return "";
+    }
+    if (labels.empty() || extra.empty()) {
+        return "{" + labels + extra + "}";
+    }
+
+    return "{" + labels + "," + extra + "}";
+}
+
+
+/**
+  * Metric class constructor
+  */
+Metric::Metric(std::string name, std::string help, std::string labels) {
+    this->name = name;
+    this->help = help;
+    this->labels = labels;
+
+    std::lock_guard<std::mutex> lock(metrics_registry_mutex());
+    metrics_registry().push_back(this);
+}
+
+std::string
+Metric::get_name() {
+    return this->name;
+}
+
+std::string
+Metric::get_help() {
+    return this->help;
+}
+
+
+/**
+  * MetricCounter class constructor
+  */
+MetricCounter::MetricCounter(std::string name, std::string help, std::string labels) : Metric(name, help, labels) {
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        this->shards[i].value.store(0);
+    }
+}
+
+void
+MetricCounter::inc(unsigned long value) {
+    this->shards[metric_shard()].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::string
+MetricCounter::get_type() {
+    return "counter";
+}
+
+void
+MetricCounter::render(std::ostream &os) {
+    unsigned long total = 0;
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        total += this->shards[i].value.load(std::memory_order_relaxed);
+    }
+
+    os << this->name << format_labels(this->labels, "") << " " << total << "\n";
+}
+
+
+/**
+  * MetricGauge class constructor
+  */
+MetricGauge::MetricGauge(std::string name, std::string help, std::string labels) : Metric(name, help, labels) {
+    this->value.store(0);
+}
+
+void
+MetricGauge::inc() {
+    this->value.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+MetricGauge::dec() {
+    this->value.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::string
+MetricGauge::get_type() {
+    return "gauge";
+}
+
+void
+MetricGauge::render(std::ostream &os) {
+    os << this->name << format_labels(this->labels, "") << " " << this->value.load(std::memory_order_relaxed) << "\n";
+}
+
+
+/**
+  * MetricHistogram class constructor; 'bounds' are the upper bounds of the
+  * buckets in microseconds, in increasing order. Bounds beyond
+  * METRIC_MAX_BUCKETS are dropped (their observations fall into +Inf).
+  */
+MetricHistogram::MetricHistogram(std::string name, std::string help, std::vector<long> bounds, std::string labels) : Metric(name, help, labels) {
+    if (bounds.size() > METRIC_MAX_BUCKETS) {
+        bounds.resize(METRIC_MAX_BUCKETS);
+    }
+    this->bounds = bounds;
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        for (size_t j = 0; j < METRIC_MAX_BUCKETS; j++) {
+            this->shards[i].buckets[j].store(0);
+        }
+        this->shards[i].count.store(0);
+        this->shards[i].sum.store(0);
+    }
+}
+
+void
+MetricHistogram::observe(long usecs) {
+    if (usecs < 0) {
+        usecs = 0;
+    }
+
+    Shard &shard = this->shards[metric_shard()];
+    size_t bucket = std::lower_bound(this->bounds.begin(), this->bounds.end(), usecs) - this->bounds.begin();
+    if (bucket < this->bounds.size()) {
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(usecs, std::memory_order_relaxed);
+}
+
+std::string
+MetricHistogram::get_type() {
+    return "histogram";
+}
+
+void
+MetricHistogram::render(std::ostream &os) {
+    std::vector<unsigned long> buckets(this->bounds.size(), 0);
+    unsigned long count = 0;
+    unsigned long sum = 0;
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        for (size_t j = 0; j < this->bounds.size(); j++) {
+            buckets[j] += this->shards[i].buckets[j].load(std::memory_order_relaxed);
+        }
+        count += this->shards[i].count.load(std::memory_order_relaxed);
+        sum += this->shards[i].sum.load(std::memory_order_relaxed);
+    }
+
+    // buckets are kept per range and only made cumulative here
+    unsigned long cumulative = 0;
+    for (size_t j = 0; j < this->bounds.size(); j++) {
+        cumulative += buckets[j];
+        os << this->name << "_bucket" << format_labels(this->labels, "le=\"" + usecs_to_secs(this->bounds[j]) + "\"") << " " << cumulative << "\n";
+    }
+    os << this->name << "_bucket" << format_labels(this->labels, "le=\"+Inf\"") << " " << count << "\n";
+    os << this->name << "_sum" << format_labels(this->labels, "") << " " << usecs_to_secs(sum) << "\n";
+    os << this->name << "_count" << format_labels(this->labels, "") << " " << count << "\n";
+}
+
+
+/**
+  * Function to get the number of threads of this process (Linux only).
+  */
+static long
+process_threads() {
+    std::ifstream fin("/proc/self/status");
+    std::string line;
+    while (getline(fin, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return std::stol(line.substr(8));
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+  * Function to render all registered metrics in Prometheus text exposition
+  * format. Metrics sharing a name (differing only in labels) are grouped
+  * under a single HELP/TYPE header.
+  */
+void
+render_metrics(std::ostream &os) {
+    std::lock_guard<std::mutex> lock(metrics_registry_mutex());
+    std::vector<Metric *> &registry = metrics_registry();
+
+    std::vector<std::string> rendered;
+    for (Metric *metric : registry) {
+        std::string name = metric->get_name();
+        if (std::find(rendered.begin(), rendered.end(), name) != rendered.end()) {
+            continue;
+        }
+        rendered.push_back(name);
+
+        os << "# HELP " << name << " " << metric->get_help() << "\n";
+        os << "# TYPE " << name << " " << metric->get_type() << "\n";
+        for (Metric *family_metric : registry) {
+            if (family_metric->get_name() == name) {
+                family_metric->render(os);
+            }
+        }
+    }
+
+    long threads = process_threads();
+    if (threads >= 0) {
+        os << "# HELP dnsperf_process_threads Number of OS threads of the DNSPerf process.\n";
+        os << "# TYPE dnsperf_process_threads gauge\n";
+        os << "dnsperf_process_threads " << threads << "\n";
+    }
+}
+
+
+/**
+  * Bucket bounds (usecs) for DNS query latencies and scheduling delays.
+  */
+static const std::vector<long> latency_buckets = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+/**
+  * Bucket bounds (usecs) for database writes and lock waits.
+  */
+static const std::vector<long> db_buckets = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+};
+
+MetricCounter scheduler_rounds("dnsperf_scheduler_rounds_total",
+    "Number of DNS query rounds dispatched by the fixed-interval scheduler.");
+MetricCounter scheduler_replans("dnsperf_scheduler_replans_total",
+    "Number of times the budgeted sampling scheduler re-derived per-domain query rates.");
+MetricHistogram scheduler_dispatch_lag("dnsperf_scheduler_dispatch_lag_seconds",
+    "Delay between the scheduled and the actual start of a DNS query.", latency_buckets);
+MetricGauge query_threads("dnsperf_query_threads",
+    "Number of live DNS query threads (querying or persisting results).");
+MetricCounter scheduler_skipped_queries("dnsperf_scheduler_skipped_queries_total",
+    "Number of due DNS queries skipped because too many were outstanding.");
+
+MetricGauge dns_queries_in_flight("dnsperf_dns_queries_in_flight",
+    "Number of DNS queries waiting for a reply.");
+MetricCounter dns_queries_succeeded("dnsperf_dns_queries_total",
+    "Number of DNS queries sent, by outcome.", "result=\"success\"");
+MetricCounter dns_queries_failed("dnsperf_dns_queries_total",
+    "Number of DNS queries sent, by outcome.", "result=\"failure\"");
+MetricCounter dns_resolver_failures("dnsperf_dns_resolver_failures_total",
+    "Number of failures to create a DNS resolver.");
+MetricHistogram dns_query_latency("dnsperf_dns_query_latency_seconds",
+    "Measured DNS query latency.", latency_buckets);
+
+MetricGauge db_queue_depth("dnsperf_db_queue_depth",
+    "Number of query threads waiting for the database connection.");
+MetricHistogram db_lock_wait("dnsperf_db_lock_wait_seconds",
+    "Time spent waiting for the database connection.", db_buckets);
+MetricHistogram db_summary_write_latency("dnsperf_db_write_latency_seconds",
+    "Latency of database writes, by table.", db_buckets, "table=\"DomainSummary\"");
+MetricHistogram db_records_write_latency("dnsperf_db_write_latency_seconds",
+    "Latency of database writes, by table.", db_buckets, "table=\"LatencyRecords\"");
+MetricCounter db_summary_write_failures("dnsperf_db_write_failures_total",
+    "Number of failed database writes, by table.", "table=\"DomainSummary\"");
+MetricCounter db_records_write_failures("dnsperf_db_write_failures_total",
+    "Number of failed database writes, by table.", "table=\"LatencyRecords\"");
@@ -0,0 +1,151 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef DNS_PERF_METRICS_H
+#define DNS_PERF_METRICS_H 1
+
+/**
+  * Number of shards each counter and histogram is split into. Updating
+  * threads are spread over the shards so that they rarely contend on the
+  * same cache line; the shards are only summed up on scrape.
+  */
+#define METRIC_SHARDS 16
+
+/**
+  * Maximum number of buckets of a histogram (excluding +Inf). Buckets are
+  * stored inline in each shard so that shards never share a cache line.
+  */
+#define METRIC_MAX_BUCKETS 16
+
+/**
+  * A single metric of the registry, rendered in Prometheus text format.
+  */
+class Metric {
+
+    protected:
+        std::string name;
+        std::string help;
+        std::string labels;
+
+    public:
+        Metric(std::string, std::string, std::string);
+
+        virtual ~Metric() {}
+
+        std::string get_name();
+
+        std::string get_help();
+
+        virtual std::string get_type() = 0;
+
+        virtual void render(std::ostream &) = 0;
+};
+
+/**
+  * Monotonically increasing counter.
+  */
+class MetricCounter : public Metric {
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<unsigned long> value;
+        };
+
+        Shard shards[METRIC_SHARDS];
+
+    public:
+        MetricCounter(std::string, std::string, std::string labels = "");
+
+        void inc(unsigned long value = 1);
+
+        std::string get_type();
+
+        void render(std::ostream &);
+};
+
+/**
+  * Value that can go up and down (in-flight queries, queue depths, etc).
+  */
+class MetricGauge : public Metric {
+
+    private:
+        std::atomic<long> value;
+
+    public:
+        MetricGauge(std::string, std::string, std::string labels = "");
+
+        void inc();
+
+        void dec();
+
+        std::string get_type();
+
+        void render(std::ostream &);
+};
+
+/**
+  * Histogram of durations, observed in microseconds and exported in seconds.
+  */
+class MetricHistogram : public Metric {
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<unsigned long> buckets[METRIC_MAX_BUCKETS];
+            std::atomic<unsigned long> count;
+            std::atomic<unsigned long> sum;
+        };
+
+        std::vector<long> bounds;
+        Shard shards[METRIC_SHARDS];
+
+    public:
+        MetricHistogram(std::string, std::string, std::vector<long>, std::string labels = "");
+
+        void observe(long);
+
+        std::string get_type();
+
+        void render(std::ostream &);
+};
+
+/**
+  * Function to render all registered metrics in Prometheus text exposition format.
+  */
+void render_metrics(std::ostream &);
+
+/**
+  * Metrics of the scheduler.
+  */
+extern MetricCounter scheduler_rounds;
+extern MetricCounter scheduler_replans;
+extern MetricHistogram scheduler_dispatch_lag;
+extern MetricGauge query_threads;
+extern MetricCounter scheduler_skipped_queries;
+
+/**
+  * Metrics of the DNS query path.
+  */
+extern MetricGauge dns_queries_in_flight;
+extern MetricCounter dns_queries_succeeded;
+extern MetricCounter dns_queries_failed;
+extern MetricCounter dns_resolver_failures;
+extern MetricHistogram dns_query_latency;
+
+/**
+  * Metrics of the persistence path.
+  */
+extern MetricGauge db_queue_depth;
+extern MetricHistogram db_lock_wait;
+extern MetricHistogram db_summary_write_latency;
+extern MetricHistogram db_records_write_latency;
+extern MetricCounter db_summary_write_failures;
+extern MetricCounter db_records_write_failures;
+
+#endif
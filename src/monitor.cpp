@@ -5,11 +5,18 @@
 
 #include <sstream>
 #include <cstdlib>
+#include <cstring>
 #include <thread>
 #include "monitor.h"
+#include "query_server.h"
+#include "metrics.h"
+#include "sampler.h"
 #include <ctime>
 #include <ldns.h>
 #include <cmath>
+#include <queue>
+#include <algorithm>
+#include <atomic>
 
 /**
   * Set of alpha-numeric characters
@@ -30,10 +37,32 @@ gen_random_prefix() {
     return os.str();
 }
 
+/**
+  * Function to convert a (possibly NULL) MySQL DATETIME value to a UNIX
+  * timestamp; returns 0 for NULL.
+  */
+time_t
+parse_datetime(const mysqlpp::String &value) {
+    if (value.is_null()) {
+        return 0;
+    }
+
+    struct tm tm_buf;
+    memset(&tm_buf, 0, sizeof(tm_buf));
+    std::string value_str = std::string(value);
+    if (strptime(value_str.c_str(), "%Y-%m-%d %H:%M:%S", &tm_buf) == NULL) {
+        return 0;
+    }
+    tm_buf.tm_isdst = -1;
+
+    return mktime(&tm_buf);
+}
+
+
 /**
   * DNSPerfMonitor class constructor
   */
-DNSPerfMonitor::DNSPerfMonitor(int interval, std::string db_name, std::string db_user, std::string db_pass, std::string db_host, std::vector<std::string> domains) {
+DNSPerfMonitor::DNSPerfMonitor(int interval, std::string db_name, std::string db_user, std::string db_pass, std::string db_host, std::vector<std::string> domains, int query_port, double query_budget, double min_query_rate) {
     this->connection = mysqlpp::Connection(true);
     this->interval = interval;
     this->db_name = db_name;
@@ -41,6 +70,11 @@ DNSPerfMonitor::DNSPerfMonitor(int interval, std::string db_name, std::string db
     this->db_pass = db_pass;
     this->db_host = db_host;
     this->domains = domains;
+    this->query_port = query_port;
+    this->stats_snapshot = std::make_shared<const DomainSnapshotMap>();
+    this->query_budget = query_budget;
+    this->min_query_rate = min_query_rate;
+    this->sampling_plan = std::make_shared<const SamplingPlan>();
     this->running = false;
 }
 
@@ -95,6 +129,143 @@ DNSPerfMonitor::get_domains() {
 }
 
 
+/**
+  * Function to get the loopback port of the live query endpoint (0 if disabled).
+  */
+int
+DNSPerfMonitor::get_query_port() {
+    return this->query_port;
+}
+
+
+/**
+  * Function to get the latest published snapshot of domain statistics.
+  * Readers never take the lock under which the snapshot is updated; the
+  * returned snapshot stays valid (and unchanged) for as long as it is held.
+  */
+StatsSnapshotPtr
+DNSPerfMonitor::get_stats_snapshot() {
+    return std::atomic_load(&this->stats_snapshot);
+}
+
+
+/**
+  * Function to get the total DNS query budget (queries/sec) of the budgeted
+  * sampling mode (0 if queries are issued at a fixed interval).
+  */
+double
+DNSPerfMonitor::get_query_budget() {
+    return this->query_budget;
+}
+
+
+/**
+  * Function to get the minimum per-domain query rate (queries/sec) of the
+  * budgeted sampling mode.
+  */
+double
+DNSPerfMonitor::get_min_query_rate() {
+    return this->min_query_rate;
+}
+
+
+/**
+  * Function to get the latest per-domain query rates assigned by the
+  * budgeted sampling scheduler.
+  */
+SamplingPlanPtr
+DNSPerfMonitor::get_sampling_plan() {
+    return std::atomic_load(&this->sampling_plan);
+}
+
+
+/**
+  * Function to publish new per-domain query rates.
+  */
+void
+DNSPerfMonitor::set_sampling_plan(SamplingPlanPtr sampling_plan) {
+    std::atomic_store(&this->sampling_plan, sampling_plan);
+}
+
+
+/**
+  * Function to build the initial snapshot of domain statistics from the
+  * local state synced with the database. The most recent latency records of
+  * each domain are read once here so that percentiles, recent samples and
+  * sampling rates survive a restart.
+  */
+void
+DNSPerfMonitor::init_stats_snapshot() {
+    std::shared_ptr<DomainSnapshotMap> snapshot = std::make_shared<DomainSnapshotMap>();
+
+    for (std::map<std::string, int>::iterator it = this->record_count_map.begin(); it != this->record_count_map.end(); ++it) {
+        std::shared_ptr<DomainSnapshot> domain_snapshot = std::make_shared<DomainSnapshot>();
+        domain_snapshot->domain_name = it->first;
+        domain_snapshot->record_count = it->second;
+        domain_snapshot->mean_latency = this->mean_latency_map[it->first];
+        domain_snapshot->std_dev = this->std_dev_map[it->first];
+        domain_snapshot->last_update_time = this->last_update_time_map[it->first];
+
+        if (it->second > 0) {
+            try {
+                std::stringstream query_str;
+                query_str << "SELECT latency, query_time FROM LatencyRecords " <<
+                    "WHERE domain_id = (SELECT id FROM DomainSummary WHERE domain_name=\"" << it->first << "\") " <<
+                    "ORDER BY id DESC LIMIT " << DNS_PERF_RECENT_SAMPLES << ";";
+                mysqlpp::Query query = this->connection.query(query_str.str());
+                mysqlpp::StoreQueryResult res = query.store();
+
+                // rows come newest first; samples are kept oldest first
+                for (mysqlpp::StoreQueryResult::const_reverse_iterator row_it = res.rbegin(); row_it != res.rend(); ++row_it) {
+                    mysqlpp::Row row = *row_it;
+                    LatencySample sample = { parse_datetime(row[1]), (int) std::stof(std::string(row[0])) };
+                    domain_snapshot->recent_samples.push_back(sample);
+                }
+            }
+            catch(const mysqlpp::BadQuery &e) {
+                std::cerr << "Failed to fetch recent latency records for domain '" << it->first << "' from table 'LatencyRecords' (starting without them) : " << e.what() << std::endl;
+            }
+        }
+
+        (*snapshot)[it->first] = domain_snapshot;
+    }
+
+    std::atomic_store(&this->stats_snapshot, StatsSnapshotPtr(snapshot));
+}
+
+
+/**
+  * Function to publish a new snapshot carrying the latest statistics for a
+  * domain (read-copy-update). The domain map is copied, sharing the entries
+  * of all other domains, and swapped in atomically. Must be called with
+  * 'db_mutex' held so that concurrent writers do not lose updates.
+  */
+void
+DNSPerfMonitor::publish_domain_snapshot(std::string domain_name, int record_count, float mean_latency, float std_dev, int latency) {
+    StatsSnapshotPtr current = std::atomic_load(&this->stats_snapshot);
+    std::shared_ptr<DomainSnapshotMap> snapshot = std::make_shared<DomainSnapshotMap>(*current);
+
+    std::shared_ptr<DomainSnapshot> domain_snapshot = std::make_shared<DomainSnapshot>();
+    domain_snapshot->domain_name = domain_name;
+    domain_snapshot->record_count = record_count;
+    domain_snapshot->mean_latency = mean_latency;
+    domain_snapshot->std_dev = std_dev;
+    domain_snapshot->last_update_time = time(0);
+
+    DomainSnapshotMap::const_iterator it = current->find(domain_name);
+    if (it != current->end()) {
+        const std::vector<LatencySample> &samples = it->second->recent_samples;
+        size_t skip = (samples.size() >= DNS_PERF_RECENT_SAMPLES) ? samples.size() - DNS_PERF_RECENT_SAMPLES + 1 : 0;
+        domain_snapshot->recent_samples.assign(samples.begin() + skip, samples.end());
+    }
+    LatencySample sample = { domain_snapshot->last_update_time, latency };
+    domain_snapshot->recent_samples.push_back(sample);
+
+    (*snapshot)[domain_name] = domain_snapshot;
+    std::atomic_store(&this->stats_snapshot, StatsSnapshotPtr(snapshot));
+}
+
+
 /**
   * Function to initialize the DNSPerf Monitor's internal state such as 
   * database connection, local data, etc.
@@ -174,32 +345,13 @@ DNSPerfMonitor::init() {
                         this->mean_latency_map.insert(std::pair<std::string, float>(domain_name, mean_latency));
                         float std_dev = std::stof(std::string(row[4]));
                         this->std_dev_map.insert(std::pair<std::string, float>(domain_name, std_dev));
+                        this->last_update_time_map.insert(std::pair<std::string, time_t>(domain_name, parse_datetime(row[6])));
                     }
                     
                     std::cout << "Success!" << std::endl;
                 }
                 else {
                     std::cout << "Not Found!" << std::endl;
-                    std::cout << "Initializing with default domain statistics in the database... ";
-                    try {
-                        for (std::vector<std::string>::iterator it = domains.begin() ; it != this->domains.end(); ++it) {
-                            std::string domain_name = *it;
-                            std::stringstream query_str;
-                            query_str << "INSERT INTO DomainSummary VALUES (DEFAULT, \"" << domain_name << "\", DEFAULT, DEFAULT, DEFAULT, DEFAULT, DEFAULT);";
-                            mysqlpp::Query query = this->connection.query(query_str.str());
-                            mysqlpp::SimpleResult res = query.execute();
-                            
-                            this->record_count_map.insert(std::pair<std::string, int>(domain_name, 0));
-                            this->mean_latency_map.insert(std::pair<std::string, float>(domain_name, 0.0));
-                            this->std_dev_map.insert(std::pair<std::string, float>(domain_name, 0.0));
-                        }
-                    
-                        std::cout << "Success!" << std::endl;
-                    }
-                    catch(mysqlpp::BadQuery e) {
-                        std::cout << "Failure!" << std::endl;
-                        std::cerr << "Failed to add domains to the table 'DomainSummary' (will be skipped) : " << e.what() << std::endl;
-                    }
                 }
             }
             catch(mysqlpp::BadQuery e) {
@@ -208,6 +360,46 @@ DNSPerfMonitor::init() {
                 std::cout << "Terminated." << std::endl;
                 exit(5);
             }
+
+            // add domains from the domain list (all of them on first run, new ones after the list grows) missing in the database
+            std::vector<std::string> missing_domains;
+            for (std::vector<std::string>::iterator it = this->domains.begin(); it != this->domains.end(); ++it) {
+                if (this->record_count_map.find(*it) == this->record_count_map.end() &&
+                        std::find(missing_domains.begin(), missing_domains.end(), *it) == missing_domains.end()) {
+                    missing_domains.push_back(*it);
+                }
+            }
+
+            if (!missing_domains.empty()) {
+                std::cout << "Initializing with default domain statistics in the database for " << missing_domains.size() << " domain(s)... ";
+                int failed_domains = 0;
+                for (std::vector<std::string>::iterator it = missing_domains.begin(); it != missing_domains.end(); ++it) {
+                    std::string domain_name = *it;
+                    try {
+                        std::stringstream query_str;
+                        query_str << "INSERT INTO DomainSummary VALUES (DEFAULT, \"" << domain_name << "\", DEFAULT, DEFAULT, DEFAULT, DEFAULT, DEFAULT);";
+                        mysqlpp::Query query = this->connection.query(query_str.str());
+                        mysqlpp::SimpleResult res = query.execute();
+
+                        this->record_count_map.insert(std::pair<std::string, int>(domain_name, 0));
+                        this->mean_latency_map.insert(std::pair<std::string, float>(domain_name, 0.0));
+                        this->std_dev_map.insert(std::pair<std::string, float>(domain_name, 0.0));
+                        this->last_update_time_map.insert(std::pair<std::string, time_t>(domain_name, 0));
+                    }
+                    catch(const mysqlpp::BadQuery &e) {
+                        if (failed_domains++ == 0) {
+                            std::cout << "Failure!" << std::endl;
+                        }
+                        std::cerr << "Failed to add domain '" << domain_name << "' to the table 'DomainSummary' (will be skipped) : " << e.what() << std::endl;
+                    }
+                }
+
+                if (failed_domains == 0) {
+                    std::cout << "Success!" << std::endl;
+                }
+            }
+
+            this->init_stats_snapshot();
         }
         else {
             std::cout << "Failure!" << std::endl;
@@ -239,10 +431,20 @@ DNSPerfMonitor::update_dns_latency_records(std::string domain_name, int latency)
     float new_std_dev;
 
     // begin critical section; compute and update local state and update database via the shared connection.
+    db_queue_depth.inc();
+    std::chrono::high_resolution_clock::time_point lock_start = std::chrono::high_resolution_clock::now();
     this->db_mutex.lock();
+    std::chrono::high_resolution_clock::time_point lock_end = std::chrono::high_resolution_clock::now();
+    db_queue_depth.dec();
+    db_lock_wait.observe(std::chrono::duration_cast<std::chrono::microseconds>(lock_end - lock_start).count());
     
     std::map<std::string, int>::iterator count_it = this->record_count_map.find(domain_name);
-    if (count_it != this->record_count_map.end()) {
+    if (count_it == this->record_count_map.end()) {
+        this->db_mutex.unlock();
+        std::cerr << "No summary for domain '" << domain_name << "' in the table 'DomainSummary'; skipping its latency record." << std::endl;
+        return;
+    }
+    else {
         current_record_count = count_it->second;
         new_record_count = current_record_count + 1;
         this->record_count_map[domain_name] = new_record_count;
@@ -267,7 +469,11 @@ DNSPerfMonitor::update_dns_latency_records(std::string domain_name, int latency)
         this->std_dev_map[domain_name] = new_std_dev;
     }
 
+    // publish the new statistics to readers of the live query endpoint before touching the database
+    this->publish_domain_snapshot(domain_name, new_record_count, new_mean_latency, new_std_dev, latency);
+
     // update database
+    std::chrono::high_resolution_clock::time_point write_start = std::chrono::high_resolution_clock::now();
     try {
 		std::stringstream query_str;
 		query_str << "UPDATE DomainSummary " <<
@@ -284,10 +490,14 @@ DNSPerfMonitor::update_dns_latency_records(std::string domain_name, int latency)
 		mysqlpp::SimpleResult res = query.execute();
 	}
 	catch(mysqlpp::BadQuery e) {
+        db_summary_write_failures.inc();
 		std::cerr << "Failed to update summary for domain '" << domain_name << "' in the table 'DomainSummary' : " << e.what() << std::endl;
         std::cerr << "Skipping this round of update for domain '" << domain_name << "'." << std::endl;
 	}
+    std::chrono::high_resolution_clock::time_point write_end = std::chrono::high_resolution_clock::now();
+    db_summary_write_latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(write_end - write_start).count());
 
+    write_start = write_end;
     try {
 		std::stringstream query_str;
 		query_str << "INSERT INTO LatencyRecords VALUES(" <<
@@ -300,9 +510,12 @@ DNSPerfMonitor::update_dns_latency_records(std::string domain_name, int latency)
 		mysqlpp::SimpleResult res = query.execute();
 	}
 	catch(mysqlpp::BadQuery e) {
+        db_records_write_failures.inc();
 		std::cerr << "Failed to add latency record for '" << domain_name << "' in the table 'LatencyRecords' : " << e.what() << std::endl;
         std::cerr << "Skipping this round of latency record for domain '" << domain_name << "'." << std::endl;
 	}
+    write_end = std::chrono::high_resolution_clock::now();
+    db_records_write_latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(write_end - write_start).count());
 
     // end of critical section
     this->db_mutex.unlock();
@@ -312,10 +525,11 @@ DNSPerfMonitor::update_dns_latency_records(std::string domain_name, int latency)
 
 /**
   * Function (run as thread) to make actual DNS query for a given domain name
-  * and measure the latency.
+  * and measure the latency. 'scheduled_time' is when the scheduler intended the
+  * query to start.
   */
 void
-send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr) {
+send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr, std::chrono::high_resolution_clock::time_point scheduled_time) {
     ldns_resolver *res;
     ldns_rdf *domain;
     ldns_pkt *p;
@@ -327,6 +541,9 @@ send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr) {
     domain = NULL;
     res = NULL;
 
+    query_threads.inc();
+    scheduler_dispatch_lag.observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - scheduled_time).count());
+
     // create pseudo sub-domain using random prefix to avoid DNS caching
     std::ostringstream os;
     os << gen_random_prefix() << "." << domain_name;
@@ -340,9 +557,12 @@ send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr) {
 
     if (s != LDNS_STATUS_OK) {
 	    std::cerr << "Failed to create DNS resolver." << std::endl;
+        dns_resolver_failures.inc();
+        query_threads.dec();
         return;
     }
 
+    dns_queries_in_flight.inc();
     std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 
     // use the resolver to send a query for the DNS Type A records of the domain
@@ -354,15 +574,19 @@ send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr) {
 
 
     std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    dns_queries_in_flight.dec();
     
     int latency = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
+    dns_query_latency.observe(latency);
 
     ldns_rdf_deep_free(domain);
 
 	if (!p)  {
 	    std::cerr << "Failed to receive a DNS reply for domain " << domain_name << std::endl;
+        dns_queries_failed.inc();
 	}
 	else {
+        dns_queries_succeeded.inc();
          // retrieve the DNS Type A records from the answer section of that packet
         a_recs = ldns_pkt_rr_list_by_type(p,
                                       LDNS_RR_TYPE_A,
@@ -379,6 +603,7 @@ send_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr) {
 
     monitor_ptr->update_dns_latency_records(domain_name, latency);
 
+    query_threads.dec();
 }
 
 
@@ -390,14 +615,19 @@ run_periodic_dns_queries(DNSPerfMonitor *monitor_ptr) {
 
     std::cout << "DNSPerf is running." << std::endl;
 
+    // start of the current round according to schedule; a round is due one interval after the previous one started
+    std::chrono::high_resolution_clock::time_point scheduled_time = std::chrono::high_resolution_clock::now();
+
     while(monitor_ptr->is_running()) {
 
         std::vector<std::thread> dns_queries;
+        std::chrono::high_resolution_clock::time_point round_start = std::chrono::high_resolution_clock::now();
+        scheduler_rounds.inc();
 
         std::vector<std::string> domains = monitor_ptr->get_domains();
         for(std::vector<std::string>::iterator it = domains.begin(); it != domains.end(); ++it) {
             std::string domain_name = *it;
-            dns_queries.push_back(std::thread(send_dns_query, domain_name, monitor_ptr));
+            dns_queries.push_back(std::thread(send_dns_query, domain_name, monitor_ptr, scheduled_time));
         }
 
         for(std::thread& dns_query : dns_queries) {
@@ -406,8 +636,124 @@ run_periodic_dns_queries(DNSPerfMonitor *monitor_ptr) {
 
         std::chrono::seconds refresh_interval(monitor_ptr->get_interval());
         std::this_thread::sleep_for(refresh_interval);
+        scheduled_time = round_start + refresh_interval;
+    }
+
+}
+
+
+/**
+  * Function (run as detached thread) to make a DNS query on behalf of the
+  * budgeted sampling scheduler, which waits on 'outstanding' at shutdown.
+  */
+void
+send_budgeted_dns_query(std::string domain_name, DNSPerfMonitor *monitor_ptr, std::chrono::high_resolution_clock::time_point scheduled_time, std::atomic<int> *outstanding) {
+    send_dns_query(domain_name, monitor_ptr, scheduled_time);
+    outstanding->fetch_sub(1);
+}
+
+
+/**
+  * Function (run as thread) to issue DNS queries within a total query budget.
+  * Each domain is queried at its own rate, re-derived every interval from the
+  * recent variability of its latency (see compute_sampling_plan()), so that
+  * flat domains are queried rarely and noisy or changing ones often.
+  */
+void
+run_budgeted_dns_queries(DNSPerfMonitor *monitor_ptr) {
+    typedef std::chrono::high_resolution_clock::time_point time_point;
+    typedef std::pair<time_point, std::string> due_query;
+
+    std::cout << "DNSPerf is running with a budget of " << monitor_ptr->get_query_budget() << " queries/sec." << std::endl;
+
+    // sample each listed domain once, and only those with a summary in the database (the others' results would be dropped)
+    std::vector<std::string> domains;
+    std::vector<std::string> listed_domains = monitor_ptr->get_domains();
+    StatsSnapshotPtr snapshot = monitor_ptr->get_stats_snapshot();
+    for (std::vector<std::string>::iterator it = listed_domains.begin(); it != listed_domains.end(); ++it) {
+        if (std::find(domains.begin(), domains.end(), *it) != domains.end()) {
+            continue;
+        }
+        if (snapshot->find(*it) == snapshot->end()) {
+            std::cerr << "Domain '" << *it << "' has no summary in the table 'DomainSummary'; it will not be sampled." << std::endl;
+            continue;
+        }
+        domains.push_back(*it);
+    }
+
+    if (domains.empty()) {
+        std::cerr << "No domains to sample." << std::endl;
+        return;
+    }
+
+    std::atomic<int> outstanding(0);
+    std::chrono::seconds replan_interval(monitor_ptr->get_interval());
+
+    SamplingPlanPtr plan = compute_sampling_plan(monitor_ptr->get_stats_snapshot(), domains, monitor_ptr->get_query_budget(), monitor_ptr->get_min_query_rate());
+    monitor_ptr->set_sampling_plan(plan);
+
+    // spread the first query of each domain over its period to avoid an initial burst
+    std::priority_queue<due_query, std::vector<due_query>, std::greater<due_query> > due_queries;
+    std::map<std::string, time_point> last_dispatch_times;
+    time_point now = std::chrono::high_resolution_clock::now();
+    for (std::vector<std::string>::iterator it = domains.begin(); it != domains.end(); ++it) {
+        std::chrono::microseconds period((long) (1000000.0 / plan->at(*it).rate));
+        std::chrono::microseconds offset((long) (period.count() * ((double) rand() / RAND_MAX)));
+        due_queries.push(due_query(now + offset, *it));
+        last_dispatch_times[*it] = now + offset - period;
+    }
+    time_point next_replan = now + replan_interval;
+
+    while (monitor_ptr->is_running()) {
+        now = std::chrono::high_resolution_clock::now();
+
+        if (now >= next_replan) {
+            plan = compute_sampling_plan(monitor_ptr->get_stats_snapshot(), domains, monitor_ptr->get_query_budget(), monitor_ptr->get_min_query_rate());
+            monitor_ptr->set_sampling_plan(plan);
+            scheduler_replans.inc();
+            next_replan = now + replan_interval;
+
+            // bring forward domains whose period has shrunk since their next query was scheduled
+            std::vector<due_query> rescheduled;
+            while (!due_queries.empty()) {
+                due_query pending = due_queries.top();
+                due_queries.pop();
+                std::chrono::microseconds period((long) (1000000.0 / plan->at(pending.second).rate));
+                pending.first = std::min(pending.first, std::max(last_dispatch_times[pending.second] + period, now));
+                rescheduled.push_back(pending);
+            }
+            for (due_query &pending : rescheduled) {
+                due_queries.push(pending);
+            }
+        }
+
+        due_query next = due_queries.top();
+        if (next.first > now) {
+            // sleep until the next query is due, waking up periodically to notice a shutdown
+            time_point wake_time = std::min(next.first, next_replan);
+            std::this_thread::sleep_for(std::min<std::chrono::high_resolution_clock::duration>(wake_time - now, std::chrono::milliseconds(500)));
+            continue;
+        }
+        due_queries.pop();
+        last_dispatch_times[next.second] = next.first;
+
+        // skip this round of the domain if resolver or database throughput has fallen behind the budget
+        if (outstanding.load() >= DNS_PERF_MAX_OUTSTANDING_QUERIES) {
+            scheduler_skipped_queries.inc();
+        }
+        else {
+            outstanding.fetch_add(1);
+            std::thread(send_budgeted_dns_query, next.second, monitor_ptr, next.first, &outstanding).detach();
+        }
+
+        // schedule the next query at the domain's current rate, without catching up on missed ones
+        std::chrono::microseconds period((long) (1000000.0 / plan->at(next.second).rate));
+        due_queries.push(due_query(std::max(next.first + period, now), next.second));
     }
 
+    while (outstanding.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 }
 
 
@@ -418,6 +764,21 @@ void
 DNSPerfMonitor::run() {
 
     this->running = true;
-    std::thread monitoring_thread = std::thread(run_periodic_dns_queries, this);
+    std::thread monitoring_thread;
+    if (this->query_budget > 0) {
+        monitoring_thread = std::thread(run_budgeted_dns_queries, this);
+    }
+    else {
+        monitoring_thread = std::thread(run_periodic_dns_queries, this);
+    }
+
+    std::thread query_server_thread;
+    if (this->query_port > 0) {
+        query_server_thread = std::thread(run_query_server, this);
+    }
+
     monitoring_thread.join();
+    if (query_server_thread.joinable()) {
+        query_server_thread.join();
+    }
 }
@@ -6,14 +6,68 @@
 #include <mysql++.h>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <ctime>
 
 #ifndef DNS_PERF_MONITOR_H
 #define DNS_PERF_MONITOR_H 1
 
+/**
+  * Maximum number of recent latency samples retained per domain in the
+  * in-memory snapshot (used for percentile and recent-sample queries).
+  */
+#define DNS_PERF_RECENT_SAMPLES 256
+
+/**
+  * Maximum number of DNS queries the budgeted sampling scheduler keeps
+  * outstanding (querying or waiting on the database); due queries beyond it
+  * are skipped until the backlog drains.
+  */
+#define DNS_PERF_MAX_OUTSTANDING_QUERIES 256
+
+struct LatencySample {
+    time_t query_time;
+    int latency;
+};
+
+/**
+  * Immutable per-domain statistics as seen by the live query endpoint.
+  */
+struct DomainSnapshot {
+    std::string domain_name;
+    int record_count;
+    float mean_latency;
+    float std_dev;
+    time_t last_update_time;
+    std::vector<LatencySample> recent_samples;
+};
+
+typedef std::map<std::string, std::shared_ptr<const DomainSnapshot> > DomainSnapshotMap;
+typedef std::shared_ptr<const DomainSnapshotMap> StatsSnapshotPtr;
+
+/**
+  * Per-domain query rate assigned by the budgeted sampling scheduler, along
+  * with the recent-window statistics it was derived from.
+  */
+struct DomainSamplingRate {
+    std::string domain_name;
+    size_t samples;
+    double mean_latency;
+    double std_dev;
+    double change;
+    double weight;
+    double rate;
+    double ci_half_width;
+};
+
+typedef std::map<std::string, DomainSamplingRate> SamplingPlan;
+typedef std::shared_ptr<const SamplingPlan> SamplingPlanPtr;
+
 class DNSPerfMonitor {
 
     private:
-        bool running;
+        std::atomic<bool> running;
 
         std::mutex db_mutex;
         mysqlpp::Connection connection;
@@ -27,9 +81,21 @@ class DNSPerfMonitor {
         std::map<std::string, int> record_count_map;
         std::map<std::string, float> mean_latency_map;
         std::map<std::string, float> std_dev_map;
+        std::map<std::string, time_t> last_update_time_map;
+
+        int query_port;
+        StatsSnapshotPtr stats_snapshot;
+
+        double query_budget;
+        double min_query_rate;
+        SamplingPlanPtr sampling_plan;
+
+        void init_stats_snapshot();
+
+        void publish_domain_snapshot(std::string, int, float, float, int);
 
     public:
-        DNSPerfMonitor(int, std::string, std::string, std::string, std::string, std::vector<std::string>);
+        DNSPerfMonitor(int, std::string, std::string, std::string, std::string, std::vector<std::string>, int, double, double);
 
         ~DNSPerfMonitor();
 
@@ -45,6 +111,18 @@ class DNSPerfMonitor {
         
         std::vector<std::string> get_domains();
 
+        int get_query_port();
+
+        StatsSnapshotPtr get_stats_snapshot();
+
+        double get_query_budget();
+
+        double get_min_query_rate();
+
+        SamplingPlanPtr get_sampling_plan();
+
+        void set_sampling_plan(SamplingPlanPtr);
+
         void update_dns_latency_records(std::string, int);
 };
 
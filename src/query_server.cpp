@@ -0,0 +1,342 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "query_server.h"
+#include "metrics.h"
+#include "sampler.h"
+
+/**
+  * Maximum size of an HTTP request accepted by the query endpoint.
+  */
+#define MAX_REQUEST_SIZE 4096
+
+/**
+  * Function to fetch the value of a parameter from an URL query string.
+  */
+static std::string
+get_query_param(const std::string &query_string, const std::string &name) {
+    std::istringstream is(query_string);
+    std::string param;
+    while (getline(is, param, '&')) {
+        size_t pos = param.find('=');
+        if (pos != std::string::npos && param.substr(0, pos) == name) {
+            return param.substr(pos + 1);
+        }
+    }
+
+    return "";
+}
+
+
+/**
+  * Function to format a UNIX timestamp as a MySQL-style DATETIME string.
+  */
+static std::string
+format_time(time_t t) {
+    if (t == 0) {
+        return "NULL";
+    }
+
+    char buf[32];
+    struct tm tm_buf;
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm_buf));
+    return std::string(buf);
+}
+
+
+/**
+  * Function to compute the nearest-rank percentile of a sorted set of latencies.
+  */
+static int
+latency_percentile(const std::vector<int> &sorted_latencies, double percentile) {
+    if (sorted_latencies.empty()) {
+        return 0;
+    }
+
+    size_t rank = (size_t) ceil(percentile / 100.0 * sorted_latencies.size());
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > sorted_latencies.size()) {
+        rank = sorted_latencies.size();
+    }
+
+    return sorted_latencies[rank - 1];
+}
+
+
+/**
+  * Function to select the domains a request applies to: the one named by the
+  * 'domain' parameter, or all domains in the snapshot if none is named.
+  */
+static std::vector<std::shared_ptr<const DomainSnapshot> >
+select_domains(const StatsSnapshotPtr &snapshot, const std::string &domain_name) {
+    std::vector<std::shared_ptr<const DomainSnapshot> > selected;
+    if (domain_name.empty()) {
+        for (DomainSnapshotMap::const_iterator it = snapshot->begin(); it != snapshot->end(); ++it) {
+            selected.push_back(it->second);
+        }
+    }
+    else {
+        DomainSnapshotMap::const_iterator it = snapshot->find(domain_name);
+        if (it != snapshot->end()) {
+            selected.push_back(it->second);
+        }
+    }
+
+    return selected;
+}
+
+
+/**
+  * Function to build the response body for a request path; returns the HTTP
+  * status code.
+  */
+static int
+handle_request(DNSPerfMonitor *monitor_ptr, const std::string &path, const std::string &query_string, std::ostringstream &body) {
+    if (path == "/metrics") {
+        render_metrics(body);
+        return 200;
+    }
+
+    std::string domain_name = get_query_param(query_string, "domain");
+
+    // the sampling plan covers every domain of the domain list, including ones not yet seen in the snapshot
+    if (path == "/sampling") {
+        SamplingPlanPtr plan = monitor_ptr->get_sampling_plan();
+        if (!domain_name.empty() && plan->find(domain_name) == plan->end()) {
+            body << "Unknown domain '" << domain_name << "'." << std::endl;
+            return 404;
+        }
+
+        body << "Domain Name\tQuery Rate (queries/sec)\tRecent Samples\tRecent Mean Latency (usecs)\tRecent Mean 95% CI (usecs)\tRecent Standard Deviation (usecs)\tRecent Change (usecs)" << std::endl;
+        for (SamplingPlan::const_iterator it = plan->begin(); it != plan->end(); ++it) {
+            const DomainSamplingRate &rate = it->second;
+            if (!domain_name.empty() && rate.domain_name != domain_name) {
+                continue;
+            }
+            body << rate.domain_name << "\t" << rate.rate << "\t" << rate.samples << "\t" << rate.mean_latency << "\t" <<
+                "+/-" << rate.ci_half_width << "\t" << rate.std_dev << "\t" << rate.change << std::endl;
+        }
+        return 200;
+    }
+
+    // take a reference to the current snapshot; it is immutable and never blocks the query workers
+    StatsSnapshotPtr snapshot = monitor_ptr->get_stats_snapshot();
+    std::vector<std::shared_ptr<const DomainSnapshot> > selected = select_domains(snapshot, domain_name);
+
+    if (path != "/summary" && path != "/percentiles" && path != "/samples") {
+        body << "Unknown path '" << path << "'. Supported: /summary, /percentiles, /samples, /sampling, /metrics" << std::endl;
+        return 404;
+    }
+
+    if (!domain_name.empty() && selected.empty()) {
+        body << "Unknown domain '" << domain_name << "'." << std::endl;
+        return 404;
+    }
+
+    if (path == "/summary") {
+        body << "Domain Name\tTotal Records\tMean Latency (usecs)\tMean Latency 95% CI (usecs)\tLatency Standard Deviation (usecs)\tLast Update Time" << std::endl;
+        for (std::shared_ptr<const DomainSnapshot> &domain : selected) {
+            double ci_half_width = (domain->record_count > 1) ? SAMPLING_CI_Z * domain->std_dev / sqrt((double) domain->record_count) : 0.0;
+            body << domain->domain_name << "\t" << domain->record_count << "\t" << domain->mean_latency << "\t" <<
+                "+/-" << ci_half_width << "\t" << domain->std_dev << "\t" << format_time(domain->last_update_time) << std::endl;
+        }
+    }
+    else if (path == "/percentiles") {
+        std::vector<double> percentiles;
+        std::string p_param = get_query_param(query_string, "p");
+        if (p_param.empty()) {
+            p_param = "50,90,99";
+        }
+        std::istringstream is(p_param);
+        std::string p;
+        while (getline(is, p, ',')) {
+            double value = atof(p.c_str());
+            if (value <= 0.0 || value > 100.0) {
+                body << "Invalid percentile '" << p << "'." << std::endl;
+                return 400;
+            }
+            percentiles.push_back(value);
+        }
+
+        body << "Domain Name\tSamples";
+        for (double percentile : percentiles) {
+            body << "\tP" << percentile << " (usecs)";
+        }
+        body << std::endl;
+
+        for (std::shared_ptr<const DomainSnapshot> &domain : selected) {
+            std::vector<int> latencies;
+            for (const LatencySample &sample : domain->recent_samples) {
+                latencies.push_back(sample.latency);
+            }
+            std::sort(latencies.begin(), latencies.end());
+
+            body << domain->domain_name << "\t" << latencies.size();
+            for (double percentile : percentiles) {
+                body << "\t" << latency_percentile(latencies, percentile);
+            }
+            body << std::endl;
+        }
+    }
+    else {
+        size_t limit = DNS_PERF_RECENT_SAMPLES;
+        std::string limit_param = get_query_param(query_string, "limit");
+        if (!limit_param.empty()) {
+            int value = atoi(limit_param.c_str());
+            if (value <= 0) {
+                body << "Invalid limit '" << limit_param << "'." << std::endl;
+                return 400;
+            }
+            limit = std::min(limit, (size_t) value);
+        }
+
+        body << "Domain Name\tLatency (usecs)\tDNS Query Time" << std::endl;
+        for (std::shared_ptr<const DomainSnapshot> &domain : selected) {
+            const std::vector<LatencySample> &samples = domain->recent_samples;
+            size_t skip = (samples.size() > limit) ? samples.size() - limit : 0;
+            for (std::vector<LatencySample>::const_iterator it = samples.begin() + skip; it != samples.end(); ++it) {
+                body << domain->domain_name << "\t" << it->latency << "\t" << format_time(it->query_time) << std::endl;
+            }
+        }
+    }
+
+    return 200;
+}
+
+
+/**
+  * Function to read a single HTTP request from a client and write back the
+  * response.
+  */
+static void
+serve_client(DNSPerfMonitor *monitor_ptr, int client_fd) {
+    char buf[MAX_REQUEST_SIZE];
+    std::string request;
+
+    // read until the end of the request line; the rest of the request is ignored
+    while (request.find("\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE) {
+        ssize_t n = recv(client_fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return;
+        }
+        request.append(buf, n);
+    }
+
+    std::string method, target;
+    std::istringstream is(request.substr(0, request.find("\r\n")));
+    is >> method >> target;
+
+    std::string path = target;
+    std::string query_string;
+    size_t pos = target.find('?');
+    if (pos != std::string::npos) {
+        path = target.substr(0, pos);
+        query_string = target.substr(pos + 1);
+    }
+
+    std::ostringstream body;
+    int status;
+    if (method != "GET") {
+        body << "Only GET requests are supported." << std::endl;
+        status = 405;
+    }
+    else {
+        status = handle_request(monitor_ptr, path, query_string, body);
+    }
+
+    const char *reason = (status == 200) ? "OK" : (status == 400) ? "Bad Request" : (status == 404) ? "Not Found" : "Method Not Allowed";
+    std::string body_str = body.str();
+    std::ostringstream response;
+    response << "HTTP/1.0 " << status << " " << reason << "\r\n" <<
+        "Content-Type: " << ((path == "/metrics") ? "text/plain; version=0.0.4; charset=utf-8" : "text/plain; charset=utf-8") << "\r\n" <<
+        "Content-Length: " << body_str.size() << "\r\n" <<
+        "Connection: close\r\n\r\n" << body_str;
+
+    std::string response_str = response.str();
+    size_t sent = 0;
+    while (sent < response_str.size()) {
+        ssize_t n = send(client_fd, response_str.data() + sent, response_str.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+}
+
+
+/**
+  * Function (run as thread) to serve live domain statistics from the
+  * monitor's in-memory snapshots, and the monitor's own metrics, over HTTP
+  * on the loopback interface.
+  */
+void
+run_query_server(DNSPerfMonitor *monitor_ptr) {
+    int port = monitor_ptr->get_query_port();
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        std::cerr << "Failed to create socket for the live query endpoint : " << strerror(errno) << std::endl;
+        return;
+    }
+
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(server_fd, 16) < 0) {
+        std::cerr << "Failed to listen on 127.0.0.1:" << port << " for the live query endpoint : " << strerror(errno) << std::endl;
+        close(server_fd);
+        return;
+    }
+
+    std::cout << "DNSPerf live query endpoint is listening on http://127.0.0.1:" << port << "/" << std::endl;
+
+    while (monitor_ptr->is_running()) {
+        // wake up periodically to notice a shutdown
+        struct pollfd pfd;
+        pfd.fd = server_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd < 0) {
+            continue;
+        }
+
+        // bound the time a slow client can hold up the endpoint
+        struct timeval timeout;
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        serve_client(monitor_ptr, client_fd);
+        close(client_fd);
+    }
+
+    close(server_fd);
+}
@@ -0,0 +1,19 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <string>
+#include "monitor.h"
+
+#ifndef DNS_PERF_QUERY_SERVER_H
+#define DNS_PERF_QUERY_SERVER_H 1
+
+/**
+  * Function (run as thread) to serve live domain statistics from the
+  * monitor's in-memory snapshots, and the monitor's own metrics (Prometheus
+  * text format at '/metrics'), over HTTP on the loopback interface.
+  */
+void run_query_server(DNSPerfMonitor *);
+
+#endif
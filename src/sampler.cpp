@@ -0,0 +1,142 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <cmath>
+#include <algorithm>
+#include "sampler.h"
+
+/**
+  * Function to compute the recent-window statistics of a domain from its
+  * latest snapshot. The sampling weight is the latency standard deviation
+  * over the window plus the shift of the most recent samples away from the
+  * window mean, so both noisy and recently changed domains are favoured.
+  * The weight is negative if there are too few samples to judge.
+  */
+static DomainSamplingRate
+compute_domain_stats(const std::string &domain_name, const DomainSnapshot *domain_snapshot) {
+    DomainSamplingRate stats;
+    stats.domain_name = domain_name;
+    stats.samples = 0;
+    stats.mean_latency = 0.0;
+    stats.std_dev = 0.0;
+    stats.change = 0.0;
+    stats.weight = -1.0;
+    stats.rate = 0.0;
+    stats.ci_half_width = 0.0;
+
+    if (domain_snapshot == NULL) {
+        return stats;
+    }
+
+    const std::vector<LatencySample> &samples = domain_snapshot->recent_samples;
+    size_t n = samples.size();
+    stats.samples = n;
+    if (n == 0) {
+        return stats;
+    }
+
+    double sum = 0.0;
+    for (const LatencySample &sample : samples) {
+        sum += sample.latency;
+    }
+    stats.mean_latency = sum / n;
+
+    if (n < SAMPLING_MIN_SAMPLES) {
+        return stats;
+    }
+
+    double sq_sum = 0.0;
+    for (const LatencySample &sample : samples) {
+        sq_sum += (sample.latency - stats.mean_latency) * (sample.latency - stats.mean_latency);
+    }
+    stats.std_dev = sqrt(sq_sum / (n - 1));
+    stats.ci_half_width = SAMPLING_CI_Z * stats.std_dev / sqrt((double) n);
+
+    double recent_sum = 0.0;
+    for (size_t i = n - SAMPLING_CHANGE_WINDOW; i < n; i++) {
+        recent_sum += samples[i].latency;
+    }
+    stats.change = fabs(recent_sum / SAMPLING_CHANGE_WINDOW - stats.mean_latency);
+
+    stats.weight = stats.std_dev + stats.change;
+    return stats;
+}
+
+
+/**
+  * Function to split a total query budget (queries/sec) across domains in
+  * proportion to their recent latency variability, with a per-domain floor.
+  *
+  * Rates are assigned by water-filling: every domain whose proportional share
+  * falls below 'min_rate' is pinned to the floor and the remaining budget is
+  * re-split among the others. If the floors alone exceed the budget, the
+  * budget is split evenly.
+  */
+SamplingPlanPtr
+compute_sampling_plan(StatsSnapshotPtr snapshot, const std::vector<std::string> &domains, double budget, double min_rate) {
+    std::shared_ptr<SamplingPlan> plan = std::make_shared<SamplingPlan>();
+    if (domains.empty()) {
+        return plan;
+    }
+
+    double max_weight = 0.0;
+    for (std::vector<std::string>::const_iterator it = domains.begin(); it != domains.end(); ++it) {
+        DomainSnapshotMap::const_iterator snapshot_it = snapshot->find(*it);
+        const DomainSnapshot *domain_snapshot = (snapshot_it != snapshot->end()) ? snapshot_it->second.get() : NULL;
+        DomainSamplingRate stats = compute_domain_stats(*it, domain_snapshot);
+        max_weight = std::max(max_weight, stats.weight);
+        (*plan)[*it] = stats;
+    }
+
+    // domains without enough samples yet are treated like the noisiest known domain
+    for (SamplingPlan::iterator it = plan->begin(); it != plan->end(); ++it) {
+        if (it->second.weight < 0.0) {
+            it->second.weight = (max_weight > 0.0) ? max_weight : 1.0;
+        }
+    }
+
+    if (min_rate * plan->size() >= budget) {
+        for (SamplingPlan::iterator it = plan->begin(); it != plan->end(); ++it) {
+            it->second.rate = budget / plan->size();
+        }
+        return plan;
+    }
+
+    std::vector<DomainSamplingRate *> unpinned;
+    for (SamplingPlan::iterator it = plan->begin(); it != plan->end(); ++it) {
+        unpinned.push_back(&it->second);
+    }
+
+    double remaining_budget = budget;
+    while (!unpinned.empty()) {
+        double total_weight = 0.0;
+        for (DomainSamplingRate *stats : unpinned) {
+            total_weight += stats->weight;
+        }
+
+        std::vector<DomainSamplingRate *> still_unpinned;
+        for (DomainSamplingRate *stats : unpinned) {
+            double share = (total_weight > 0.0) ? remaining_budget * stats->weight / total_weight : remaining_budget / unpinned.size();
+            if (share < min_rate) {
+                stats->rate = min_rate;
+            }
+            else {
+                still_unpinned.push_back(stats);
+            }
+        }
+
+        if (still_unpinned.size() == unpinned.size()) {
+            for (DomainSamplingRate *stats : unpinned) {
+                stats->rate = (total_weight > 0.0) ? remaining_budget * stats->weight / total_weight : remaining_budget / unpinned.size();
+            }
+            break;
+        }
+
+        remaining_budget -= min_rate * (unpinned.size() - still_unpinned.size());
+        unpinned = still_unpinned;
+    }
+
+    return plan;
+}
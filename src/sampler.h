@@ -0,0 +1,36 @@
+/**
+  * @author Dhruv Sharma (dhsharma@cs.ucsd.edu)
+  */
+
+
+#include <string>
+#include <vector>
+#include "monitor.h"
+
+#ifndef DNS_PERF_SAMPLER_H
+#define DNS_PERF_SAMPLER_H 1
+
+/**
+  * Minimum number of recent samples before a domain's variance is trusted;
+  * domains with fewer samples are sampled as eagerly as the noisiest domain.
+  */
+#define SAMPLING_MIN_SAMPLES 8
+
+/**
+  * Number of most recent samples compared against the rest of the window to
+  * detect a recent change in a domain's latency.
+  */
+#define SAMPLING_CHANGE_WINDOW 8
+
+/**
+  * z-score of the reported confidence intervals (95%).
+  */
+#define SAMPLING_CI_Z 1.96
+
+/**
+  * Function to split a total query budget (queries/sec) across domains in
+  * proportion to their recent latency variability, with a per-domain floor.
+  */
+SamplingPlanPtr compute_sampling_plan(StatsSnapshotPtr, const std::vector<std::string> &, double, double);
+
+#endif